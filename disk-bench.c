@@ -0,0 +1,143 @@
+/*
+ ============================================================================
+ Name        : disk-bench.c
+ Description : block device throughput benchmark; runs sequential writes,
+               sequential reads and random reads through disk.h on a
+               striped/mirrored set of images and on a single image of the
+               same size (baseline), and prints the speedup
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "disk.h"
+
+#define RANDOM_READS 5000   // random requests in the random read phase
+#define NPHASES 3
+
+static const char *phase[NPHASES] = { "seq write", "seq read", "random read" };
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/** runs the benchmark phases on the device already open, with requests of
+ *  req blocks, and stores the throughput of each phase in mbs (MB/s)
+ */
+static void run(unsigned req, double mbs[NPHASES]) {
+    unsigned n = disk_size();
+    unsigned long blocks;
+    char *buf;
+
+    if (posix_memalign((void **)&buf, DISK_DIRECT_ALIGN, (size_t)req * DISK_BLOCK_SIZE) != 0) {
+        printf("can't allocate buffer\n");
+        exit(1);
+    }
+    memset(buf, 0xa5, (size_t)req * DISK_BLOCK_SIZE);
+
+    double t0 = now();
+    for (unsigned b = 0; b < n; b += req)
+        disk_writev(b, n - b < req ? n - b : req, buf);
+    mbs[0] = n * (double)DISK_BLOCK_SIZE / (now() - t0) / (1024 * 1024);
+
+    t0 = now();
+    for (unsigned b = 0; b < n; b += req)
+        disk_readv(b, n - b < req ? n - b : req, buf);
+    mbs[1] = n * (double)DISK_BLOCK_SIZE / (now() - t0) / (1024 * 1024);
+
+    srand(1);
+    blocks = 0;
+    t0 = now();
+    for (int i = 0; i < RANDOM_READS; i++) {  // one request-aligned request each
+        unsigned b = rand() % (n / req) * req;
+        disk_readv(b, req, buf);
+        blocks += req;
+    }
+    mbs[2] = blocks * (double)DISK_BLOCK_SIZE / (now() - t0) / (1024 * 1024);
+
+    free(buf);
+}
+
+/**
+ * MAIN
+ * disk-bench [-force] [-direct] [-stripe | -mirror] diskfile nblocks
+ * diskfile is img1,img2,... with -stripe or -mirror; the baseline uses
+ * a temporary single image img1.single of the same size
+ * the benchmark overwrites the whole device, so the images must not exist
+ * unless -force is given; img1.single must never exist
+ */
+int main(int argc, char *argv[]) {
+    int flags = 0, force = 0;
+    double mbs[NPHASES], base[NPHASES];
+
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-force")) force = 1;
+        else if (!strcmp(argv[1], "-direct")) flags |= DISK_DIRECT;
+        else if (!strcmp(argv[1], "-stripe")) flags |= DISK_STRIPE;
+        else if (!strcmp(argv[1], "-mirror")) flags |= DISK_MIRROR;
+        else break;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+    if (argc != 3) {
+        printf("use: %s [-force] [-direct] [-stripe | -mirror] diskfile nblocks\n", argv[0]);
+        return 1;
+    }
+
+    char names[strlen(argv[1]) + 1];
+    int nmembers = 0;
+    strcpy(names, argv[1]);
+    for (char *name = strtok(names, ","); name; name = strtok(NULL, ","), nmembers++)
+        if (!force && access(name, F_OK) == 0) {
+            printf("%s exists, its contents would be overwritten (use -force)\n", name);
+            return 1;
+        }
+    if (nmembers == 0) {
+        printf("no disk images in %s\n", argv[1]);
+        return 1;
+    }
+    unsigned req = nmembers * DISK_STRIPE_UNIT;  // one full stripe per request
+
+    char single[strlen(argv[1]) + 8];
+    strcpy(single, argv[1]);
+    strtok(single, ",");
+    strcat(single, ".single");
+    if (access(single, F_OK) == 0) {
+        printf("%s exists, remove it to run the baseline\n", single);
+        return 1;
+    }
+
+    if (disk_init_flags(argv[1], atoi(argv[2]), flags) < 0) {
+        printf("unable to initialize %s\n", argv[1]);
+        return 1;
+    }
+    unsigned n = disk_size();
+    if (n < req) {
+        printf("device too small\n");
+        return 1;
+    }
+    run(req, mbs);
+    disk_close();
+
+    if (disk_init_flags(single, n, flags & DISK_DIRECT) < 0) {
+        printf("unable to initialize %s\n", single);
+        unlink(single);
+        return 1;
+    }
+    run(req, base);
+    disk_close();
+    unlink(single);
+
+    printf("%u blocks, %u block requests, %d image(s)\n", n, req, nmembers);
+    printf("%-12s %12s %12s %8s\n", "", "1 image", "device", "speedup");
+    for (int i = 0; i < NPHASES; i++)
+        printf("%-12s %7.1f MB/s %7.1f MB/s %7.2fx\n", phase[i], base[i], mbs[i], mbs[i] / base[i]);
+    return 0;
+}
@@ -1,49 +1,516 @@
-
+#define _GNU_SOURCE     // O_DIRECT
+#define _FILE_OFFSET_BITS 64  // images over 2 GB
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "disk.h"
 
-static FILE *diskfile;
+#define DISK_BUFS (2 * DISK_MAX_MEMBERS)  // aligned buffers in the pool
+#define LABEL_MAGIC 0xd15c1abe  // member_label.magic
+#define BUF_IO     1    // pool buffer used by direct_rw
+#define BUF_CALLER 2    // pool buffer taken with disk_buf_alloc
+#define TRACE_BATCH 512 // trace records kept in memory between file writes
+
+/** the device is made of one image file (member) or, with DISK_STRIPE or
+ *  DISK_MIRROR, of up to DISK_MAX_MEMBERS of them; requests spanning
+ *  several members are split in jobs run at the same time by one worker
+ *  thread per member, the others are done by the calling thread;
+ *  the disk_* functions must all be called from the same thread;
+ *  each image of a striped or mirrored device ends with one extra block
+ *  holding a member_label, checked when the device is opened again
+ */
+struct member_label {
+    uint32_t magic;         // LABEL_MAGIC
+    uint32_t layout;        // DISK_STRIPE or DISK_MIRROR
+    uint32_t nmembers;
+    uint32_t index;         // position of this image in the device
+    uint32_t unit;          // DISK_STRIPE_UNIT
+    uint32_t nblocks;       // device blocks stored in this image
+};
+
+struct job {
+    int write;
+    unsigned blocknum;      // member block
+    unsigned count;
+    char *data;
+    struct member *m;
+    int *left;              // jobs of the request still running
+    struct job *next;
+};
+
+struct member {
+    FILE *file;
+    int directfd;           // >= 0 if the image was opened with DISK_DIRECT
+    int created;            // the image was created by member_open
+    unsigned nblocks;       // device blocks stored in the image
+    unsigned fileblocks;    // blocks in the image file (nblocks + label)
+    unsigned queued;        // blocks queued or in progress (queue depth)
+    struct job *head, *tail;
+    pthread_t worker;
+    pthread_cond_t work;
+};
+
+static struct member members[DISK_MAX_MEMBERS];
+static int nmembers = 0;
+static int layout = 0;      // 0, DISK_STRIPE or DISK_MIRROR
+static unsigned nextrd = 0; // mirror replica to try first on the next read
+static pthread_mutex_t iolock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t iodone = PTHREAD_COND_INITIALIZER;
+static int quit = 0;        // workers must exit
+
+static char *bufpool;       // DISK_BUFS aligned buffers of DISK_BUF_SIZE bytes
+static char bufused[DISK_BUFS];  // 0, BUF_IO or BUF_CALLER
+static int callerbufs = 0;  // buffers taken with disk_buf_alloc
+static pthread_mutex_t buflock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buffree = PTHREAD_COND_INITIALIZER;
 static unsigned nblocks = 0;
 static unsigned nreads = 0;
 static unsigned nwrites = 0;
 
+static int tracefd = -1;    // >= 0 while tracing
+static struct disk_trace_hdr tracehdr;
+static struct disk_trace_rec tracebuf[TRACE_BATCH];
+static unsigned tracen;     // records in tracebuf
+static uint8_t tracecat = DISK_T_DATA;
+static struct timespec tracet0;
 
-/** opens filename as a virtual disk device;
- *  if n == -1 uses an already available "device";
- *  else creates a new "device" with n blocks;
+
+/** gets into *n the size in blocks of the image open in fd;
+ *  returns -1 (with a message) if it has more than INT_MAX blocks
+ */
+static int image_size(int fd, const char *filename, int *n) {
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    if (size < 0) return -1;
+    if (size / DISK_BLOCK_SIZE > INT_MAX) {
+        printf("DISK ERROR: %s: image too big (%lld bytes)\n", filename, (long long)size);
+        return -1;
+    }
+    fprintf(stderr, "Disk image size=%lld, %lld blocks\n",
+            (long long)size, (long long)size / DISK_BLOCK_SIZE);
+    *n = size / DISK_BLOCK_SIZE;
+    return 0;
+}
+
+/** opens filename as the image of member m with O_DIRECT;
+ *  same as member_open
+ */
+static int direct_open(struct member *m, const char *filename, int n) {
+    m->directfd = open(filename, O_RDWR | O_DIRECT);
+    if (m->directfd >= 0 && image_size(m->directfd, filename, &n) < 0) {  // ignore provided n
+        close(m->directfd);
+        m->directfd = -1;
+        return -1;
+    }
+    if (m->directfd < 0 && n > 0) {
+        m->directfd = open(filename, O_RDWR | O_DIRECT | O_CREAT | O_TRUNC, 0666);
+        if (m->directfd < 0) return -1;
+        m->created = 1;
+        ftruncate(m->directfd, (off_t)n * DISK_BLOCK_SIZE);  // only new images are sized
+    }
+    if (m->directfd < 0)
+        return -1;
+
+    m->nblocks = m->fileblocks = n;
+    return 0;
+}
+
+/** opens filename as the image of member m;
+ *  if n == -1 uses an already available image;
+ *  else creates a new image with n blocks;
  *  returns -1 if error, 0 if sucess
  */
-int disk_init(const char *filename, int n) {
-    diskfile = fopen(filename, "r+");
-    if (diskfile != NULL) {
-        fseek(diskfile, 0L, SEEK_END);   // ignore provided n
-        n = ftell(diskfile);
-        fprintf(stderr, "Disk image size=%d, %d blocks\n", n, n / DISK_BLOCK_SIZE);
-        n = n / DISK_BLOCK_SIZE;
-    }
-    if (diskfile==NULL && n>0)
-        diskfile = fopen(filename, "w+");
-    if (diskfile==NULL)
+static int member_open(struct member *m, const char *filename, int n, int flags) {
+    memset(m, 0, sizeof(*m));
+    m->directfd = -1;
+    pthread_cond_init(&m->work, NULL);
+    if (flags & DISK_DIRECT)
+        return direct_open(m, filename, n);
+
+    m->file = fopen(filename, "r+");
+    if (m->file != NULL && image_size(fileno(m->file), filename, &n) < 0) {  // ignore provided n
+        fclose(m->file);
+        m->file = NULL;
+        return -1;
+    }
+    if (m->file==NULL && n>0) {
+        m->file = fopen(filename, "w+");
+        if (m->file == NULL) return -1;
+        m->created = 1;
+        ftruncate(fileno(m->file), (off_t)n * DISK_BLOCK_SIZE);  // only new images are sized
+    }
+    if (m->file==NULL)
+        return -1;
+
+    m->nblocks = m->fileblocks = n;
+    return 0;
+}
+
+static void member_close(struct member *m) {
+    if (m->file) fclose(m->file);
+    if (m->directfd >= 0) close(m->directfd);
+    m->file = NULL;
+    m->directfd = -1;
+}
+
+static void *member_worker(void *arg);
+static void member_rw(struct member *m, int write, unsigned blocknum, unsigned count, char *data);
+
+/** reads the label block of member m (its last block) to lab;
+ *  returns 0 if it holds a member label, -1 if not
+ */
+static int label_read(struct member *m, struct member_label *lab) {
+    char block[DISK_BLOCK_SIZE];
+
+    if (m->fileblocks == 0) return -1;
+    member_rw(m, 0, m->fileblocks - 1, 1, block);
+    memcpy(lab, block, sizeof(*lab));
+    return lab->magic == LABEL_MAGIC ? 0 : -1;
+}
+
+/** writes the label of the i-th member of the device being opened
+ */
+static void label_write(int i) {
+    char block[DISK_BLOCK_SIZE];
+    struct member_label lab = { LABEL_MAGIC, layout, nmembers, i, DISK_STRIPE_UNIT,
+                                members[i].nblocks };
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, &lab, sizeof(lab));
+    member_rw(&members[i], 1, members[i].fileblocks - 1, 1, block);
+}
+
+/** checks the members just opened against their labels, or writes the
+ *  labels if all the images are new; returns -1 (with a message) if
+ *  they are not the same device, in the same order and with the same layout
+ */
+static int labels_check(const char *filename) {
+    struct member_label lab;
+    int created = 0;
+
+    for (int i = 0; i < nmembers; i++) {
+        created += members[i].created;
+        if (members[i].fileblocks == 0) {
+            printf("DISK ERROR: %s: empty image\n", filename);
+            return -1;
+        }
+        members[i].nblocks = members[i].fileblocks - 1;  // last one is the label
+    }
+    if (created == nmembers) {
+        for (int i = 0; i < nmembers; i++)
+            label_write(i);
+        return 0;
+    }
+    if (created > 0) {
+        printf("DISK ERROR: %s: mixes new and existing images\n", filename);
         return -1;
+    }
+    for (int i = 0; i < nmembers; i++)
+        if (label_read(&members[i], &lab) < 0 || lab.layout != (uint32_t)layout ||
+            lab.nmembers != (uint32_t)nmembers || lab.index != (uint32_t)i ||
+            lab.unit != DISK_STRIPE_UNIT || lab.nblocks != members[i].nblocks) {
+            printf("DISK ERROR: %s: image %d is not member %d of a %d image %s device\n",
+                   filename, i + 1, i + 1, nmembers, layout == DISK_STRIPE ? "striped" : "mirrored");
+            return -1;
+        }
+    return 0;
+}
+
+/** opens filename as a virtual disk device;
+ *  flags may be DISK_DIRECT to do all I/O with O_DIRECT, through the
+ *  aligned buffer pool when the caller's buffer is not aligned;
+ *  with DISK_STRIPE or DISK_MIRROR filename is a comma separated list of
+ *  images: blocks are spread in units of DISK_STRIPE_UNIT blocks over
+ *  them (RAID-0; a new device is rounded up to whole stripes) or written
+ *  to all of them and read from the least busy one (RAID-1); the images
+ *  must be given in the same order and with the same layout they were
+ *  created with (see member_label);
+ *  returns -1 if error, 0 if sucess
+ */
+int disk_init_flags(const char *filename, int n, int flags) {
+    char names[strlen(filename) + 1];
+    char *name, *save;
 
-    ftruncate(fileno(diskfile), n * DISK_BLOCK_SIZE);
-    nblocks = n;
+    layout = flags & (DISK_STRIPE | DISK_MIRROR);
     nreads = 0;
     nwrites = 0;
+    if (layout == 0) {
+        struct member_label lab;
+        if (member_open(&members[0], filename, n, flags) < 0) return -1;
+        if (!members[0].created && label_read(&members[0], &lab) == 0) {
+            printf("DISK ERROR: %s is member %u of a %u image device\n",
+                   filename, lab.index + 1, lab.nmembers);
+            member_close(&members[0]);
+            return -1;
+        }
+        nmembers = 1;
+        nblocks = members[0].nblocks;
+        return 0;
+    }
+    if (layout == (DISK_STRIPE | DISK_MIRROR)) return -1;
+
+    strcpy(names, filename);
+    nmembers = 0;
+    for (name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save))
+        if (++nmembers > DISK_MAX_MEMBERS) {
+            nmembers = 0;
+            return -1;
+        }
+    if (nmembers == 0) return -1;
+
+    int mn = n;  // blocks of each new member image
+    if (layout == DISK_STRIPE && n > 0) {
+        int units = (n + DISK_STRIPE_UNIT - 1) / DISK_STRIPE_UNIT;
+        mn = (units + nmembers - 1) / nmembers * DISK_STRIPE_UNIT;
+    }
+    if (n > 0) mn++;  // label block
+    strcpy(names, filename);
+    name = strtok_r(names, ",", &save);
+    for (int i = 0; i < nmembers; i++, name = strtok_r(NULL, ",", &save))
+        if (member_open(&members[i], name, mn, flags) < 0) {
+            while (i-- > 0) member_close(&members[i]);
+            nmembers = 0;
+            return -1;
+        }
+    if (labels_check(filename) < 0) {
+        strcpy(names, filename);
+        name = strtok_r(names, ",", &save);
+        for (int i = 0; i < nmembers; i++, name = strtok_r(NULL, ",", &save)) {
+            member_close(&members[i]);
+            if (members[i].created) unlink(name);  // don't leave new empty images
+        }
+        nmembers = 0;
+        return -1;
+    }
+
+    nblocks = members[0].nblocks;
+    for (int i = 1; i < nmembers; i++)
+        if (members[i].nblocks < nblocks) nblocks = members[i].nblocks;
+    if (layout == DISK_STRIPE) {
+        unsigned long long total = (unsigned long long)(nblocks / DISK_STRIPE_UNIT) *
+                                   DISK_STRIPE_UNIT * nmembers;
+        if (total > UINT_MAX) {
+            printf("DISK ERROR: %s: device too big (%llu blocks)\n", filename, total);
+            for (int i = 0; i < nmembers; i++) member_close(&members[i]);
+            nmembers = 0;
+            return -1;
+        }
+        nblocks = total;
+    }
+    if (nmembers > 1)
+        for (int i = 0; i < nmembers; i++)
+            pthread_create(&members[i].worker, NULL, member_worker, &members[i]);
     return 0;
 }
 
+/** opens filename as a virtual disk device;
+ *  if n == -1 uses an already available "device";
+ *  else creates a new "device" with n blocks;
+ *  returns -1 if error, 0 if sucess
+ */
+int disk_init(const char *filename, int n) {
+    return disk_init_flags(filename, n, 0);
+}
+
 /** returns the device size in blocks
  */
 unsigned disk_size() { 
 	return nblocks; 
 }
 
+/** takes a buffer from the pool, marking it with owner (BUF_IO or
+ *  BUF_CALLER); waits for one to be freed if all are in use
+ */
+static char *buf_get(char owner) {
+    pthread_mutex_lock(&buflock);
+    if (bufpool == NULL &&
+        posix_memalign((void **)&bufpool, DISK_DIRECT_ALIGN, DISK_BUFS * DISK_BUF_SIZE) != 0) {
+        printf("DISK ERROR: can't allocate buffer pool\n");
+        abort();
+    }
+    if (owner == BUF_CALLER && ++callerbufs > DISK_BUFS - DISK_MAX_MEMBERS) {
+        printf("DISK ERROR: more than %d buffers taken with disk_buf_alloc!\n",
+               DISK_BUFS - DISK_MAX_MEMBERS);
+        abort();
+    }
+    while (1) {
+        for (int i = 0; i < DISK_BUFS; i++)
+            if (!bufused[i]) {
+                bufused[i] = owner;
+                pthread_mutex_unlock(&buflock);
+                return bufpool + i * DISK_BUF_SIZE;
+            }
+        pthread_cond_wait(&buffree, &buflock);
+    }
+}
+
+/** returns a DISK_DIRECT_ALIGN aligned buffer with DISK_BUF_SIZE bytes
+ *  from the pool; callers may keep up to DISK_BUFS - DISK_MAX_MEMBERS
+ *  (the rest is left for the I/O of each member) and abort if they
+ *  take more
+ */
+char *disk_buf_alloc() {
+    return buf_get(BUF_CALLER);
+}
+
+/** returns buf to the pool
+ */
+void disk_buf_free(char *buf) {
+    pthread_mutex_lock(&buflock);
+    int i = (buf - bufpool) / DISK_BUF_SIZE;
+    if (bufused[i] == BUF_CALLER) callerbufs--;
+    bufused[i] = 0;
+    pthread_cond_signal(&buffree);
+    pthread_mutex_unlock(&buflock);
+}
+
+static void direct_error(void) {
+    printf("DISK ERROR: couldn't access simulated disk: %s\n", strerror(errno));
+    abort();
+}
+
+/** O_DIRECT read (write != 0: write) of len bytes at byte offset off of
+ *  member m;
+ *  aligned requests on aligned buffers go straight to the device, the
+ *  others go through a pool buffer covering the enclosing aligned span
+ *  (read-modify-write for writes); a span past the end of an image with an
+ *  odd number of blocks is trimmed back with ftruncate
+ */
+static void direct_rw(struct member *m, int write, off_t off, size_t len, char *data) {
+    int directfd = m->directfd;
+    off_t disksz = (off_t)m->fileblocks * DISK_BLOCK_SIZE;
+
+    while (len > 0) {
+        off_t start = off & ~(off_t)(DISK_DIRECT_ALIGN - 1);
+        size_t head = off - start;
+        size_t n = len < DISK_BUF_SIZE - head ? len : DISK_BUF_SIZE - head;
+        size_t span = (head + n + DISK_DIRECT_ALIGN - 1) & ~(size_t)(DISK_DIRECT_ALIGN - 1);
+        int aligned = head == 0 && n == span;
+
+        if (aligned && (uintptr_t)data % DISK_DIRECT_ALIGN == 0) {
+            ssize_t r = write ? pwrite(directfd, data, n, off) : pread(directfd, data, n, off);
+            if (r != (ssize_t)n) direct_error();
+        } else {
+            char *buf = buf_get(BUF_IO);
+            if (!write || !aligned) {
+                ssize_t r = pread(directfd, buf, span, start);
+                if (r < 0 || (!write && (size_t)r < head + n)) direct_error();
+                memset(buf + r, 0, span - r);  // beyond the end of the image
+            }
+            if (write) {
+                memcpy(buf + head, data, n);
+                if (pwrite(directfd, buf, span, start) != (ssize_t)span) direct_error();
+                if (start + (off_t)span > disksz) ftruncate(directfd, disksz);
+            } else {
+                memcpy(data, buf + head, n);
+            }
+            disk_buf_free(buf);
+        }
+        off += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/** writes the buffered trace records to their ring slots and the header;
+ *  on a write error reports it and stops tracing
+ */
+static void trace_flush(void) {
+    unsigned done = 0;
+
+    while (done < tracen) {
+        unsigned slot = (tracehdr.total + done) % tracehdr.nrecords;
+        unsigned n = tracen - done;
+        if (n > tracehdr.nrecords - slot) n = tracehdr.nrecords - slot;
+        size_t len = n * sizeof(struct disk_trace_rec);
+        if (pwrite(tracefd, tracebuf + done, len,
+                   sizeof(tracehdr) + (off_t)slot * sizeof(struct disk_trace_rec)) != (ssize_t)len)
+            goto error;
+        done += n;
+    }
+    tracehdr.total += tracen;
+    tracehdr.nblocks = nblocks;
+    tracen = 0;
+    if (pwrite(tracefd, &tracehdr, sizeof(tracehdr), 0) != sizeof(tracehdr))
+        goto error;
+    return;
+
+error:
+    printf("DISK ERROR: can't write block I/O trace (tracing stopped): %s\n", strerror(errno));
+    close(tracefd);
+    tracefd = -1;
+    tracen = 0;
+}
+
+/** records one I/O of count blocks starting at blocknum
+ */
+static void trace(int op, unsigned blocknum, unsigned count) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    while (count > 0) {  // count is 16 bits in a record
+        unsigned n = count < UINT16_MAX ? count : UINT16_MAX;
+        struct disk_trace_rec *r = &tracebuf[tracen++];
+        r->usec = (uint64_t)(t.tv_sec - tracet0.tv_sec) * 1000000 + (t.tv_nsec - tracet0.tv_nsec) / 1000;
+        r->block = blocknum;
+        r->count = n;
+        r->op = op;
+        r->cat = tracecat;
+        if (tracen == TRACE_BATCH) {
+            trace_flush();
+            if (tracefd < 0) return;
+        }
+        blocknum += n;
+        count -= n;
+    }
+}
+
+/** starts tracing all block I/O to filename, a ring with nrecords records;
+ *  the trace is flushed by disk_trace_stop, disk_close or at exit;
+ *  returns -1 if error, 0 if sucess
+ */
+int disk_trace_start(const char *filename, unsigned nrecords) {
+    static int atexit_done;
+
+    if (tracefd >= 0 || nrecords == 0) return -1;
+    tracefd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (tracefd < 0) return -1;
+    memset(&tracehdr, 0, sizeof(tracehdr));
+    tracehdr.magic = DISK_TRACE_MAGIC;
+    tracehdr.nrecords = nrecords;
+    tracen = 0;
+    clock_gettime(CLOCK_MONOTONIC, &tracet0);
+    if (!atexit_done) {
+        atexit(disk_trace_stop);
+        atexit_done = 1;
+    }
+    return 0;
+}
+
+/** sets the caller category (DISK_T_SUPER ... DISK_T_DATA) recorded for
+ *  the following disk I/O
+ */
+void disk_trace_cat(int cat) {
+    tracecat = cat;
+}
+
+/** flushes and closes the trace file
+ */
+void disk_trace_stop() {
+    if (tracefd < 0) return;
+    trace_flush();
+    close(tracefd);
+    tracefd = -1;
+}
+
 static void sanity_check(unsigned blocknum, const void *data) {
     if (blocknum >= nblocks) {
         printf("DISK ERROR: blocknum (%d) is too big!\n", blocknum);
@@ -56,43 +523,185 @@ static void sanity_check(unsigned blocknum, const void *data) {
     }
 }
 
+/** reads (write != 0: writes) count blocks of member m, starting at the
+ *  member's block blocknum
+ */
+static void member_rw(struct member *m, int write, unsigned blocknum, unsigned count, char *data) {
+    if (m->directfd >= 0) {
+        direct_rw(m, write, (off_t)blocknum * DISK_BLOCK_SIZE, (size_t)count * DISK_BLOCK_SIZE, data);
+        return;
+    }
+
+    fseeko(m->file, (off_t)blocknum * DISK_BLOCK_SIZE, SEEK_SET);
+    //printf("write block %d (byte offset %d)\n", blocknum, blocknum * DISK_BLOCK_SIZE);
+    if ((write ? fwrite(data, DISK_BLOCK_SIZE, count, m->file)
+               : fread(data, DISK_BLOCK_SIZE, count, m->file)) != count) {
+        printf("DISK ERROR: couldn't access simulated disk: %s\n", strerror(errno));
+        abort();
+    }
+}
+
+/** runs the jobs queued to member m (one worker thread per member)
+ */
+static void *member_worker(void *arg) {
+    struct member *m = arg;
+
+    pthread_mutex_lock(&iolock);
+    while (1) {
+        while (m->head == NULL && !quit)
+            pthread_cond_wait(&m->work, &iolock);
+        if (m->head == NULL) break;
+        struct job *j = m->head;
+        m->head = j->next;
+        if (m->head == NULL) m->tail = NULL;
+        pthread_mutex_unlock(&iolock);
+        member_rw(m, j->write, j->blocknum, j->count, j->data);
+        pthread_mutex_lock(&iolock);
+        m->queued -= j->count;
+        if (--*j->left == 0) pthread_cond_broadcast(&iodone);
+    }
+    pthread_mutex_unlock(&iolock);
+    return NULL;
+}
+
+/** returns the mirror replica with the smallest queue depth, rotating
+ *  among the ones with the same depth; called with iolock held
+ */
+static struct member *pick_replica(void) {
+    struct member *best = NULL;
+
+    for (int k = 0; k < nmembers; k++) {
+        struct member *m = &members[(nextrd + k) % nmembers];
+        if (best == NULL || m->queued < best->queued) best = m;
+    }
+    nextrd = (best - members + 1) % nmembers;
+    return best;
+}
+
+/** reads (write != 0: writes) count device blocks starting at blocknum;
+ *  a request that maps to a single member job is done by this thread,
+ *  otherwise the jobs are queued to the member workers and run at the
+ *  same time
+ */
+static void device_rw(int write, unsigned blocknum, unsigned count, char *data) {
+    struct job local[DISK_MAX_MEMBERS];
+    struct job *jobs = local;
+    int njobs = 0, left;
+
+    if (nmembers == 1) {
+        member_rw(&members[0], write, blocknum, count, data);
+        return;
+    }
+
+    unsigned maxjobs = count / DISK_STRIPE_UNIT + 2;
+    if (layout == DISK_MIRROR && write) maxjobs = nmembers;
+    if (maxjobs > DISK_MAX_MEMBERS) jobs = malloc(maxjobs * sizeof(struct job));
+
+    if (layout == DISK_MIRROR && write) {
+        for (int i = 0; i < nmembers; i++)
+            jobs[njobs++] = (struct job){ write, blocknum, count, data, &members[i] };
+    } else {
+        while (count > 0) {  // in chunks that don't cross a stripe unit
+            unsigned n = DISK_STRIPE_UNIT - blocknum % DISK_STRIPE_UNIT;
+            if (n > count) n = count;
+            struct job *j = &jobs[njobs++];
+            *j = (struct job){ write, blocknum, n, data, NULL };
+            if (layout == DISK_STRIPE) {
+                unsigned unit = blocknum / DISK_STRIPE_UNIT;
+                j->m = &members[unit % nmembers];
+                j->blocknum = unit / nmembers * DISK_STRIPE_UNIT + blocknum % DISK_STRIPE_UNIT;
+            }
+            blocknum += n;
+            count -= n;
+            data += n * DISK_BLOCK_SIZE;
+        }
+    }
+
+    pthread_mutex_lock(&iolock);
+    if (njobs == 1) {
+        if (jobs[0].m == NULL) jobs[0].m = pick_replica();
+        pthread_mutex_unlock(&iolock);
+        member_rw(jobs[0].m, write, jobs[0].blocknum, jobs[0].count, jobs[0].data);
+    } else {
+        left = njobs;
+        for (int i = 0; i < njobs; i++) {
+            struct job *j = &jobs[i];
+            if (j->m == NULL) j->m = pick_replica();  // mirror read
+            j->left = &left;
+            j->next = NULL;
+            if (j->m->tail) j->m->tail->next = j;
+            else j->m->head = j;
+            j->m->tail = j;
+            j->m->queued += j->count;
+            pthread_cond_signal(&j->m->work);
+        }
+        while (left > 0)
+            pthread_cond_wait(&iodone, &iolock);
+        pthread_mutex_unlock(&iolock);
+    }
+    if (jobs != local) free(jobs);
+}
+
 /** reads one disk block to data
  */
 void disk_read(unsigned blocknum, char *data) {
     sanity_check(blocknum, data);
+    if (tracefd >= 0) trace(DISK_T_READ, blocknum, 1);
 
-    fseek(diskfile, blocknum * DISK_BLOCK_SIZE, SEEK_SET);
+    device_rw(0, blocknum, 1, data);
+    nreads++;
+}
 
-    if (fread(data, DISK_BLOCK_SIZE, 1, diskfile) == 1) {
-        nreads++;
-    } else {
-        printf("DISK ERROR: couldn't access simulated disk: %s\n", strerror(errno));
-        abort();
-    }
+/** reads count consecutive disk blocks, starting at blocknum, to data
+ *  (data must have room for count * DISK_BLOCK_SIZE bytes)
+ */
+void disk_readv(unsigned blocknum, unsigned count, char *data) {
+    if (count == 0) return;
+    sanity_check(blocknum + count - 1, data);
+    if (tracefd >= 0) trace(DISK_T_READ, blocknum, count);
+
+    device_rw(0, blocknum, count, data);
+    nreads += count;
 }
 
 /** writes data to one disk block
  */
 void disk_write(unsigned blocknum, const char *data) {
     sanity_check(blocknum, data);
+    if (tracefd >= 0) trace(DISK_T_WRITE, blocknum, 1);
 
-    fseek(diskfile, blocknum * DISK_BLOCK_SIZE, SEEK_SET);
-    //printf("write block %d (byte offset %d)\n", blocknum, blocknum * DISK_BLOCK_SIZE);
-    if (fwrite(data, DISK_BLOCK_SIZE, 1, diskfile) == 1) {
-        nwrites++;
-    } else {
-        printf("DISK ERROR: couldn't access simulated disk: %s\n", strerror(errno));
-        abort();
-    }
+    device_rw(1, blocknum, 1, (char *)data);
+    nwrites++;
+}
+
+/** writes count consecutive disk blocks, starting at blocknum, from data
+ */
+void disk_writev(unsigned blocknum, unsigned count, const char *data) {
+    if (count == 0) return;
+    sanity_check(blocknum + count - 1, data);
+    if (tracefd >= 0) trace(DISK_T_WRITE, blocknum, count);
+
+    device_rw(1, blocknum, count, (char *)data);
+    nwrites += count;
 }
 
-/** close device (closes the file that simulates teh disk device)
+/** close device (closes the files that simulate the disk device)
  */
 void disk_close() {
-    if (diskfile) {
-        //printf("%d disk block reads\n", nreads);
-        //printf("%d disk block writes\n", nwrites);
-        fclose(diskfile);
-        diskfile = 0;
+    disk_trace_stop();
+    if (nmembers > 1) {
+        pthread_mutex_lock(&iolock);
+        quit = 1;
+        for (int i = 0; i < nmembers; i++)
+            pthread_cond_signal(&members[i].work);
+        pthread_mutex_unlock(&iolock);
+        for (int i = 0; i < nmembers; i++)
+            pthread_join(members[i].worker, NULL);
+        quit = 0;
     }
+    //printf("%d disk block reads\n", nreads);
+    //printf("%d disk block writes\n", nwrites);
+    for (int i = 0; i < nmembers; i++)
+        member_close(&members[i]);
+    nmembers = 0;
 }
@@ -1,13 +1,65 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include <stdint.h>
+
 #define DISK_BLOCK_SIZE 2048
 
+#define DISK_DIRECT      1   // disk_init_flags: bypass host page cache (O_DIRECT)
+#define DISK_DIRECT_ALIGN 4096  // buffer, offset and length alignment for O_DIRECT
+#define DISK_BUF_SIZE    (16 * DISK_BLOCK_SIZE)  // bytes in each pool buffer
+#define DISK_STRIPE      2   // disk_init_flags: filename is "img1,img2,...", striped (RAID-0)
+#define DISK_MIRROR      4   // disk_init_flags: filename is "img1,img2,...", mirrored (RAID-1)
+#define DISK_MAX_MEMBERS 8   // max images of a striped or mirrored device
+#define DISK_STRIPE_UNIT 8   // consecutive blocks stored in the same member
+
 int disk_init( const char *filename, int nblocks );
+int disk_init_flags( const char *filename, int nblocks, int flags );
 unsigned disk_size();
 void disk_read( unsigned blocknum, char *data );
+void disk_readv( unsigned blocknum, unsigned count, char *data );
 void disk_write( unsigned blocknum, const char *data );
+void disk_writev( unsigned blocknum, unsigned count, const char *data );
 void disk_close();
 
+char *disk_buf_alloc();
+void disk_buf_free( char *buf );
+
+/** block I/O trace: a ring file with a disk_trace_hdr followed by
+ *  nrecords slots of disk_trace_rec; record total % nrecords is the next
+ *  to be written
+ */
+#define DISK_TRACE_MAGIC 0xd15c7ace
+
+#define DISK_T_SUPER  0   // caller categories of the traced blocks
+#define DISK_T_BITMAP 1
+#define DISK_T_INODE  2
+#define DISK_T_DIR    3
+#define DISK_T_DATA   4
+#define DISK_T_NCAT   5
+
+#define DISK_T_READ   0   // disk_trace_rec.op
+#define DISK_T_WRITE  1
+
+struct disk_trace_hdr {
+    uint32_t magic;     // DISK_TRACE_MAGIC
+    uint32_t nrecords;  // record slots in the ring
+    uint32_t nblocks;   // device size in blocks
+    uint32_t unused;
+    uint64_t total;     // records ever written (the ring keeps the last nrecords)
+};
+
+struct disk_trace_rec {
+    uint64_t usec;      // time since disk_trace_start (microseconds)
+    uint32_t block;     // first block
+    uint16_t count;     // number of consecutive blocks
+    uint8_t  op;        // DISK_T_READ or DISK_T_WRITE
+    uint8_t  cat;       // DISK_T_SUPER ... DISK_T_DATA
+};
+
+int  disk_trace_start( const char *filename, unsigned nrecords );
+void disk_trace_cat( int cat );
+void disk_trace_stop();
+
 
 #endif
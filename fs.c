@@ -28,6 +28,13 @@
  *              assuming on average that each file uses 10 blocks, we need
  *              1 inode per 10 blocks (10%) to fill the disk with files
  * after inodes follows the data blocks
+ *
+ * fs_format does not zero the inode blocks: it writes FS_MAGIC_LAZY, the
+ * inode blocks are grouped in inode groups of IGROUP_BLOCKS blocks and the
+ * super block keeps a bitmap of the groups already zeroed. A group is
+ * zeroed on its first inode_save or by fs_itable_init (run a little at a
+ * time by the shell); until then its inodes are read as FREE.
+ * Disks with FS_MAGIC have a fully zeroed inode table.
  */
 
 #define BLOCKSZ		(DISK_BLOCK_SIZE)
@@ -38,6 +45,8 @@
 
 
 #define FS_MAGIC    (0xf50f5024) // when formated the SB starts with this number
+#define FS_MAGIC_LAZY (0xf50f5025) // same, formated by fs_format with a lazy inode table
+#define IS_FS_MAGIC(M) ((M) == FS_MAGIC || (M) == FS_MAGIC_LAZY)
 #define DIRBLOCK_PER_INODE 11	 // direct block's index per inode
 #define MAXFILENAME   62         // max name size in a dirent
 
@@ -45,6 +54,13 @@
 #define INODES_PER_BLOCK		(BLOCKSZ/INODESZ)
 #define DIRENTS_PER_BLOCK		(BLOCKSZ/sizeof(struct fs_dirent))
 
+#define INODE_READV_MAX	8	// max inode blocks fetched by one disk_readv
+
+#define IGROUP_BLOCKS	8	// inode blocks per lazily initialized inode group
+#define IGROUP_MAX	1024	// max inode groups (bits in fs_sblock.igroup_init)
+#define MAX_INODES	65535	// inode numbers are uint16_t
+#define BLOCKS_PER_INODE	10	// see FS layout above
+
 #define IFDIR	4	// inode is dir
 #define IFREG	8	// inode is regular file
 
@@ -66,6 +82,7 @@ struct fs_sblock {
     uint16_t inode_cnt;      // number of inodes
     uint16_t inode_blocks;   // number of blocks with inodes
     uint16_t first_datablk;  // first block with data or dir
+    bitmap_t igroup_init[IGROUP_MAX / 8]; // inode groups already zeroed (FS_MAGIC_LAZY only)
 };
 
 // inode describing a file or directory
@@ -102,13 +119,48 @@ struct fs_sblock rootSB;
  *  returns -1 if error; 0 if is OK
  */
 int check_rootSB() {
-    if (rootSB.magic != FS_MAGIC) {
+    if (!IS_FS_MAGIC(rootSB.magic)) {
         printf("Unformatted disk!\n");
         return -1;
     }
     return 0;
 }
 
+/** returns 1 if inode group g holds valid inodes (it was zeroed), 0 if not
+ */
+int igroup_ready(unsigned g) {
+    return rootSB.magic != FS_MAGIC_LAZY || bitmap_get(rootSB.igroup_init, g);
+}
+
+/** zeroes the blocks of inode group g, if not done yet, and records it
+ *  in the super block
+ */
+void igroup_init(unsigned g) {
+    static union fs_block zeros[IGROUP_BLOCKS];
+    union fs_block block;
+
+    if (igroup_ready(g)) return;
+    unsigned first = g * IGROUP_BLOCKS;
+    disk_trace_cat(DISK_T_INODE);
+    disk_writev(INODESTART + first, MIN(IGROUP_BLOCKS, rootSB.inode_blocks - first), zeros[0].data);
+    bitmap_set(rootSB.igroup_init, g);
+    memset(block.data, 0, BLOCKSZ);
+    block.super = rootSB;
+    disk_trace_cat(DISK_T_SUPER);
+    disk_write(SBLOCK, block.data);
+}
+
+/** reads count inode table blocks, starting at the table's block first;
+ *  blocks of inode groups not zeroed yet are returned as all FREE inodes
+ */
+void itable_read(unsigned first, unsigned count, union fs_block *blocks) {
+    disk_trace_cat(DISK_T_INODE);
+    disk_readv(INODESTART + first, count, blocks[0].data);
+    for (unsigned k = 0; k < count; k++)
+        if (!igroup_ready((first + k) / IGROUP_BLOCKS))
+            memset(blocks[k].data, 0, BLOCKSZ);
+}
+
 /** finds the disk block number that contains the byte at the given file offset
  *  for the file or directory described by the given inode;
  *  returns the block number
@@ -122,6 +174,7 @@ int offset2block(struct fs_inode *inode, int offset) {
         // first indirect block index
         uint16_t data[BLOCKSZ / 2];
 
+        disk_trace_cat(DISK_T_DATA);
         disk_read(inode->indir_block, (char*)data);
         printf("returning block %d, indirect %d, %d with content %d\n", block, inode->indir_block,
                block - DIRBLOCK_PER_INODE, data[block - DIRBLOCK_PER_INODE]);
@@ -141,17 +194,68 @@ int offset2block(struct fs_inode *inode, int offset) {
 int inode_load(int ino_number, struct fs_inode *ino) {
     union fs_block block;
 
-    if ((unsigned)ino_number > rootSB.inode_cnt * INODES_PER_BLOCK) {
+    if ((unsigned)ino_number >= rootSB.inode_blocks * INODES_PER_BLOCK) {
         printf("inode number too big \n");
         ino->type = FREE;
         return -1;
     }
-    int inodeBlock = rootSB.first_inodeblk + (ino_number / INODES_PER_BLOCK);
-    disk_read(inodeBlock, block.data);
+    itable_read(ino_number / INODES_PER_BLOCK, 1, &block);
     *ino = block.inode[ino_number % INODES_PER_BLOCK];
     return 0;
 }
 
+/** load from disk the n inodes listed in ino_numbers into inos[0..n-1];
+ *  each inode block is read only once, and runs of consecutive inode blocks
+ *  are fetched together (up to INODE_READV_MAX blocks per disk_readv);
+ *  returns -1 if some ino_number is outside the existing limits (its
+ *  inos entry gets type FREE), 0 if all inodes were read
+ */
+int inode_load_many(const uint16_t *ino_numbers, int n, struct fs_inode *inos) {
+    union fs_block blocks[INODE_READV_MAX];
+    unsigned ntable = rootSB.inode_blocks * INODES_PER_BLOCK;
+    unsigned next = 0;  // lowest inode table block not yet handled
+    int ret = 0;
+
+    for (int i = 0; i < n; i++)
+        if (ino_numbers[i] >= ntable) {
+            printf("inode number too big \n");
+            inos[i].type = FREE;
+            ret = -1;
+        }
+
+    while (1) {
+        /** find the lowest wanted inode block not read yet
+         */
+        unsigned first = rootSB.inode_blocks;
+        for (int i = 0; i < n; i++) {
+            unsigned b = ino_numbers[i] / INODES_PER_BLOCK;
+            if (ino_numbers[i] < ntable && b >= next && b < first) first = b;
+        }
+        if (first == rootSB.inode_blocks) break;
+
+        /** extend the run while the following blocks are also wanted
+         */
+        unsigned count = 1;
+        while (count < INODE_READV_MAX) {
+            int wanted = 0;
+            for (int i = 0; i < n && !wanted; i++)
+                wanted = ino_numbers[i] < ntable &&
+                         ino_numbers[i] / INODES_PER_BLOCK == first + count;
+            if (!wanted) break;
+            count++;
+        }
+
+        itable_read(first, count, blocks);
+        for (int i = 0; i < n; i++) {
+            unsigned b = ino_numbers[i] / INODES_PER_BLOCK;
+            if (ino_numbers[i] < ntable && b >= first && b < first + count)
+                inos[i] = blocks[b - first].inode[ino_numbers[i] % INODES_PER_BLOCK];
+        }
+        next = first + count;
+    }
+    return ret;
+}
+
 /** save to disk the inode ino to the ino_number position;
  *  if ino_number is outside limits, nothing is done and returns -1
  *  returns 0 if saved
@@ -159,11 +263,13 @@ int inode_load(int ino_number, struct fs_inode *ino) {
 int inode_save(int ino_number, struct fs_inode *ino) {
     union fs_block block;
 
-    if ((unsigned)ino_number > rootSB.inode_cnt * INODES_PER_BLOCK) {
+    if ((unsigned)ino_number >= rootSB.inode_blocks * INODES_PER_BLOCK) {
         printf("inode number too big \n");
         return -1;
     }
+    igroup_init(ino_number / INODES_PER_BLOCK / IGROUP_BLOCKS); // first use of its group
     int inodeBlock = rootSB.first_inodeblk + (ino_number / INODES_PER_BLOCK);
+    disk_trace_cat(DISK_T_INODE);
     disk_read(inodeBlock, block.data); // read full block
     block.inode[ino_number % INODES_PER_BLOCK] = *ino; // update inode
     disk_write(inodeBlock, block.data); // write block
@@ -178,6 +284,7 @@ int inode_save(int ino_number, struct fs_inode *ino) {
 void dumpSB(int numb) {
     union fs_block block;
 
+    disk_trace_cat(DISK_T_SUPER);
     disk_read(numb, block.data);
     printf("Disk superblock %d:\n", numb);
     printf("    magic = %x\n", block.super.magic);
@@ -188,6 +295,13 @@ void dumpSB(int numb) {
            block.super.inode_cnt);
     printf("    first data block: %d\n", block.super.first_datablk);
     printf("    data blocks: %d\n", block.super.block_cnt - block.super.first_datablk );
+    if (block.super.magic == FS_MAGIC_LAZY) {
+        int ngroups = (block.super.inode_blocks + IGROUP_BLOCKS - 1) / IGROUP_BLOCKS;
+        int ready = 0;
+        for (int g = 0; g < ngroups; g++)
+            ready += bitmap_get(block.super.igroup_init, g);
+        printf("    inode groups zeroed: %d of %d\n", ready, ngroups);
+    }
 }
 
 
@@ -199,43 +313,49 @@ void fs_debug() {
     dumpSB(SBLOCK);
     if ( check_rootSB() == -1) return;
 
+    disk_trace_cat(DISK_T_SUPER);
     disk_read(SBLOCK, block.data);
     rootSB = block.super;
     printf("**************************************\n");
     printf("blocks in use - bitmap:\n");
     int nblocks = rootSB.block_cnt;
     for (int i = 0; i < rootSB.bmap_size; i++) {
+        disk_trace_cat(DISK_T_BITMAP);
         disk_read(BITMAPSTART + i, block.data);
         bitmap_print(block.data, MIN(BLOCKSZ*8, nblocks));
         nblocks -= BLOCKSZ * 8;
     }
     printf("**************************************\n");
     printf("inodes in use:\n");
-    for (int i = 0; i < rootSB.inode_blocks; i++) {
-        disk_read(INODESTART + i, block.data);
-        for (int j = 0; j < INODES_PER_BLOCK; j++)
-            if (block.inode[j].type != FREE)
-                printf(" %d: type=%d;", j + i * INODES_PER_BLOCK, block.inode[j].type);
+    union fs_block iblocks[INODE_READV_MAX];
+    for (int i = 0; i < rootSB.inode_blocks; i += INODE_READV_MAX) {
+        int count = MIN(INODE_READV_MAX, rootSB.inode_blocks - i);
+        itable_read(i, count, iblocks);
+        for (int k = 0; k < count; k++)
+            for (int j = 0; j < INODES_PER_BLOCK; j++)
+                if (iblocks[k].inode[j].type != FREE)
+                    printf(" %d: type=%d;", j + (i + k) * INODES_PER_BLOCK, iblocks[k].inode[j].type);
     }
     printf("\n**************************************\n");
 }
 
 
 /** mount root FS;
- *  open device image or create it;
+ *  open device image or create it (flags are passed to disk_init_flags);
  *  loads superblock from device into global variable rootSB;
  *  returns -1 if error
  */
-int fs_mount(char *device, int size) {
+int fs_mount(char *device, int size, int flags) {
     union fs_block block;
 
-    if (rootSB.magic == FS_MAGIC) {
+    if (IS_FS_MAGIC(rootSB.magic)) {
         printf("A disc is already mounted!\n");
         return -1;
     }
-    if (disk_init(device, size)<0) return -1; // open disk image or create if it does not exist
+    if (disk_init_flags(device, size, flags)<0) return -1; // open disk image or create if it does not exist
+    disk_trace_cat(DISK_T_SUPER);
     disk_read(SBLOCK, block.data);
-    if (block.super.magic != FS_MAGIC) {
+    if (!IS_FS_MAGIC(block.super.magic)) {
         printf("Unformatted disc! Not mounted.\n");
         return 0;
     }
@@ -244,12 +364,84 @@ int fs_mount(char *device, int size) {
 }
 
 
+/** format the device: writes the super block, then the whole block bitmap
+ *  with one sequential write, zeroes only the inode group holding the root dir
+ *  (the other groups are zeroed on first use or by fs_itable_init)
+ *  and creates an empty root dir; the formatted disk becomes mounted;
+ *  returns -1 if error
+ */
+int fs_format() {
+    struct fs_sblock sb;
+
+    if (IS_FS_MAGIC(rootSB.magic)) {
+        printf("Cannot format a mounted disk!\n");
+        return -1;
+    }
+    memset(&sb, 0, sizeof(sb));
+    sb.magic = FS_MAGIC_LAZY;
+    sb.block_cnt = disk_size();
+    sb.bmap_size = (sb.block_cnt + BLOCKSZ * 8 - 1) / (BLOCKSZ * 8);
+    sb.first_inodeblk = BITMAPSTART + sb.bmap_size;
+    // 1 inode per BLOCKS_PER_INODE blocks, at least one block of inodes
+    unsigned iblocks = (sb.block_cnt + BLOCKS_PER_INODE * INODES_PER_BLOCK - 1) /
+                       (BLOCKS_PER_INODE * INODES_PER_BLOCK);
+    sb.inode_blocks = MIN(iblocks, MAX_INODES / INODES_PER_BLOCK);
+    sb.inode_cnt = sb.inode_blocks * INODES_PER_BLOCK;
+    sb.first_datablk = sb.first_inodeblk + sb.inode_blocks;
+    if (sb.first_datablk >= sb.block_cnt) {
+        printf("Disk too small!\n");
+        return -1;
+    }
+
+    /** super block followed by the bitmap, with the metadata blocks in use
+     */
+    union fs_block *meta = calloc(1 + sb.bmap_size, sizeof(union fs_block));
+    if (meta == NULL) return -1;
+    meta[0].super = sb;
+    for (int b = 0; b < sb.first_datablk; b++)
+        bitmap_set(meta[1].data, b);
+    disk_trace_cat(DISK_T_SUPER);
+    disk_write(SBLOCK, meta[0].data);
+    disk_trace_cat(DISK_T_BITMAP);
+    disk_writev(BITMAPSTART, sb.bmap_size, meta[1].data);
+    free(meta);
+
+    rootSB = sb;
+    struct fs_inode root;
+    memset(&root, 0, sizeof(root));
+    root.type = IFDIR;
+    root.nlinks = 1;
+    return inode_save(ROOTINO, &root);
+}
+
+/** zeroes up to maxgroups inode groups not zeroed yet (incremental pass of
+ *  the lazy inode table initialization, the shell runs it between commands);
+ *  prints nothing, so it can be called while idle;
+ *  returns the number of groups still to zero or -1 if no disk is mounted
+ */
+int fs_itable_init(int maxgroups) {
+    if (rootSB.magic != FS_MAGIC_LAZY)
+        return IS_FS_MAGIC(rootSB.magic) ? 0 : -1;
+
+    int ngroups = (rootSB.inode_blocks + IGROUP_BLOCKS - 1) / IGROUP_BLOCKS;
+    int left = 0;
+    for (int g = 0; g < ngroups; g++) {
+        if (igroup_ready(g)) continue;
+        if (maxgroups > 0) {
+            igroup_init(g);
+            maxgroups--;
+        } else left++;
+    }
+    return left;
+}
+
+
 /*****************************************************/
 
 
 int print_ls(char *dirname, int ino_number) {
     struct fs_inode loaded_inode;
-    struct fs_inode child_inode;
+    struct fs_inode child_inode[DIRENTS_PER_BLOCK];
 
     /** try to load specified inode by ino_number
     */
@@ -263,14 +455,22 @@ int print_ls(char *dirname, int ino_number) {
         union fs_block dir_block;
         if (loaded_inode.dir_block[i] == 0) break;
         if (loaded_inode.dir_block[i] < disk_size() ) {
+            uint16_t child_ino[DIRENTS_PER_BLOCK];
+            int nchilds = 0;
+            disk_trace_cat(DISK_T_DIR);
             disk_read(loaded_inode.dir_block[i], dir_block.data);
-            for (int j = 0; j < DIRENTS_PER_BLOCK; j++) {
-                /** If a dirent refers to an empty inode, skip to the the next dirblock
-                */
+            /** If a dirent refers to an empty inode, skip to the the next dirblock
+            */
+            while (nchilds < DIRENTS_PER_BLOCK && dir_block.dirent[nchilds].d_ino != 0) {
+                child_ino[nchilds] = dir_block.dirent[nchilds].d_ino;
+                nchilds++;
+            }
+            /** stat all the dirents of this block at once
+            */
+            inode_load_many(child_ino, nchilds, child_inode);
+            for (int j = 0; j < nchilds; j++) {
                 struct fs_dirent *entry = &dir_block.dirent[j];
-                if (entry->d_ino == 0) break;
-                inode_load(entry->d_ino, &child_inode);
-                printf("%3d:%c%9d %s\n", entry->d_ino, child_inode.type == 8 ? 'F' : child_inode.type == 4 ? 'D' : '?', child_inode.size, entry->d_name );
+                printf("%3d:%c%9d %s\n", entry->d_ino, child_inode[j].type == 8 ? 'F' : child_inode[j].type == 4 ? 'D' : '?', child_inode[j].size, entry->d_name );
             }
 
         }
@@ -294,42 +494,47 @@ int fs_ls(char *dirname) {
 
     /** load SBLOCK data into rootSB variable
      */
+    disk_trace_cat(DISK_T_SUPER);
     disk_read(SBLOCK, s_block.data);
     rootSB = s_block.super;
 
     /** loop through the number of inode blocks that exist, listed in the SBLOCK
      */
-    for (int i = 0; i < rootSB.inode_blocks; i++) {
-        union fs_block inode_block;
-        disk_read(INODESTART + i, inode_block.data);
-        /** loop through each inode inside the current_block
-        */
-        for (int j = 0; j < INODES_PER_BLOCK; j++)
-            /** Check if inode is of a directory
+    union fs_block iblocks[INODE_READV_MAX];
+    for (int i = 0; i < rootSB.inode_blocks; i += INODE_READV_MAX) {
+        int count = MIN(INODE_READV_MAX, rootSB.inode_blocks - i);
+        itable_read(i, count, iblocks);
+        for (int b = 0; b < count; b++) {
+            union fs_block *inode_block = &iblocks[b];
+            /** loop through each inode inside the current_block
             */
-            if (inode_block.inode[j].type == IFDIR) {
-                /** Check all dir_blocks inside the inode that aren't empty
+            for (int j = 0; j < INODES_PER_BLOCK; j++)
+                /** Check if inode is of a directory
                 */
-                for (int k = 0; k < DIRBLOCK_PER_INODE; k++) {
-                    union fs_block dir_block;
-                    if (inode_block.inode[j].dir_block[k] == 0) break;
-                    /** Load dir block and get its dirents - if it's a block WITHIN disk size
+                if (inode_block->inode[j].type == IFDIR) {
+                    /** Check all dir_blocks inside the inode that aren't empty
                     */
-                    if (inode_block.inode[j].dir_block[k] < disk_size() ) {
-                        disk_read(inode_block.inode[j].dir_block[k], dir_block.data);
-                        for (int l = 0; l < DIRENTS_PER_BLOCK; l++) {
-                            /** If a dirent refers to an empty inode, skip to the the next dirblock
-                            */
-                            struct fs_dirent *entry = &dir_block.dirent[l];
-                            if (entry->d_ino == 0) break;
-                            if (strcmp(dirname, entry->d_name) == 0) {
-                                return print_ls(dirname, entry->d_ino);
+                    for (int k = 0; k < DIRBLOCK_PER_INODE; k++) {
+                        union fs_block dir_block;
+                        if (inode_block->inode[j].dir_block[k] == 0) break;
+                        /** Load dir block and get its dirents - if it's a block WITHIN disk size
+                        */
+                        if (inode_block->inode[j].dir_block[k] < disk_size() ) {
+                            disk_trace_cat(DISK_T_DIR);
+                            disk_read(inode_block->inode[j].dir_block[k], dir_block.data);
+                            for (int l = 0; l < DIRENTS_PER_BLOCK; l++) {
+                                /** If a dirent refers to an empty inode, skip to the the next dirblock
+                                */
+                                struct fs_dirent *entry = &dir_block.dirent[l];
+                                if (entry->d_ino == 0) break;
+                                if (strcmp(dirname, entry->d_name) == 0) {
+                                    return print_ls(dirname, entry->d_ino);
+                                }
                             }
                         }
                     }
                 }
-            }
-
+        }
     }
 
 
@@ -2,7 +2,9 @@
 #define FS_H
 
 void fs_debug();
-int  fs_mount();
+int  fs_mount( char *device, int size, int flags );
+int  fs_format();
+int  fs_itable_init( int maxgroups );
 int  fs_ls(char *dirname);
 
 #define O_RD 1
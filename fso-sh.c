@@ -14,14 +14,31 @@
 #include <string.h>
 
 #include "fs.h"
+#include "disk.h"
 
 #define BUFSIZE 100
+#define TRACE_RECORDS (1 << 20)  // block I/O trace ring size (records)
+#define ITINIT_STEP 1  // inode groups zeroed before each prompt
 
 void do_debug(int args) {
     if (args == 1) fs_debug();
     else printf("use: debug\n");
 }
 
+void do_format(int args) {
+    if (args == 1) {
+        if (fs_format() < 0) printf("format failed\n");
+    } else printf("use: format\n");
+}
+
+void do_itinit(int args, char *arg1) {
+    if (args == 1 || args == 2) {
+        int left = fs_itable_init(args == 2 ? atoi(arg1) : 1);
+        if (left < 0) printf("itinit failed\n");
+        else printf("%d inode groups left to zero\n", left);
+    } else printf("use: itinit [ngroups]\n");
+}
+
 void do_ls(int args, char *arg1) {
     if (args<0 || args>2)
         printf("use: ls [dirname]\n");
@@ -37,6 +54,8 @@ void do_ls(int args, char *arg1) {
 void print_help() {
     printf("Commands:\n");
     printf("    debug\n");
+    printf("    format\n");
+    printf("    itinit [<ngroups>]\n");
     printf("    ls [<dirname>]\n");
     printf("    cat   <name>\n");
     printf("    copyout <name> <file>\n");
@@ -89,21 +108,43 @@ int main(int argc, char *argv[]) {
     char arg1[1024];
     char arg2[1024];
     int  args, nblocks;
+    int  flags = 0;
 
+    while (argc > 1 && argv[1][0] == '-') {
+        int shift = 1;
+        if (!strcmp(argv[1], "-direct"))
+            flags |= DISK_DIRECT;  // bypass the host page cache
+        else if (!strcmp(argv[1], "-stripe"))
+            flags |= DISK_STRIPE;  // diskfile is img1,img2,...
+        else if (!strcmp(argv[1], "-mirror"))
+            flags |= DISK_MIRROR;  // diskfile is img1,img2,...
+        else if (!strcmp(argv[1], "-trace") && argc > 2) {
+            if (disk_trace_start(argv[2], TRACE_RECORDS) < 0) {
+                printf("can't create trace %s: %s\n", argv[2], strerror(errno));
+                return 1;
+            }
+            shift = 2;
+        } else break;
+        argv[shift] = argv[0];
+        argc -= shift;
+        argv += shift;
+    }
     if (argc != 3 && argc != 2) {
-        printf("use: %s diskfile          to use an existing disk\n", argv[0]);
-        printf("use: %s diskfile nblocks  to create a new disk with nblocks\n", argv[0]);
+        printf("use: %s [options] diskfile          to use an existing disk\n", argv[0]);
+        printf("use: %s [options] diskfile nblocks  to create a new disk with nblocks\n", argv[0]);
+        printf("options: -direct  -trace tracefile  -stripe | -mirror (diskfile is img1,img2,...)\n");
         return 1;
     }
     if (argc == 3) nblocks = atoi(argv[2]);
     else nblocks = -1;
 
-    if (fs_mount(argv[1], nblocks) < 0) {
+    if (fs_mount(argv[1], nblocks, flags) < 0) {
         printf("unable to initialize %s: %s\n", argv[1], strerror(errno));
         return 1;
     }
 
     while (1) {
+        fs_itable_init(ITINIT_STEP);  // zero the lazy inode table while idle
         printf("fso-sh> ");
         fflush(stdout);
         if (fgets(line, sizeof(line), stdin) == NULL)
@@ -114,6 +155,10 @@ int main(int argc, char *argv[]) {
 
         if (!strcmp(cmd, "debug"))
             do_debug(args);
+        else if (!strcmp(cmd, "format"))
+            do_format(args);
+        else if (!strcmp(cmd, "itinit"))
+            do_itinit(args, arg1);
         else if (!strcmp(cmd, "ls"))
             do_ls(args, arg1);
         else if (!strcmp(cmd, "copyout"))
@@ -0,0 +1,289 @@
+/*
+ ============================================================================
+ Name        : trace-sim.c
+ Description : offline block cache simulator; replays a block I/O trace
+               recorded with fso-sh -trace through LRU, CLOCK and ARC
+               caches of several sizes and prints their hit ratios
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk.h"
+
+#define NIL (-1)
+
+static const char *catname[DISK_T_NCAT] = { "super", "bitmap", "inode", "dir", "data" };
+
+static unsigned nblocks;    // device size (blocks are < nblocks)
+static unsigned *trace;     // block numbers, in access order
+static unsigned naccess;
+
+
+/*** doubly linked lists of blocks, most recently used at the head ***/
+
+struct list {
+    int head, tail;
+    unsigned size;
+};
+
+static int *prev, *next;    // links, indexed by block (one list per block)
+
+static void list_init(struct list *l) {
+    l->head = l->tail = NIL;
+    l->size = 0;
+}
+
+static void list_push(struct list *l, int b) {
+    prev[b] = NIL;
+    next[b] = l->head;
+    if (l->head != NIL) prev[l->head] = b;
+    else l->tail = b;
+    l->head = b;
+    l->size++;
+}
+
+static void list_remove(struct list *l, int b) {
+    if (prev[b] != NIL) next[prev[b]] = next[b];
+    else l->head = next[b];
+    if (next[b] != NIL) prev[next[b]] = prev[b];
+    else l->tail = prev[b];
+    l->size--;
+}
+
+
+/*** replacement policies: each returns the number of hits for a cache
+ *** with c blocks ***/
+
+static unsigned sim_lru(unsigned c) {
+    char *cached = calloc(nblocks, 1);
+    struct list l;
+    unsigned hits = 0;
+
+    list_init(&l);
+    for (unsigned i = 0; i < naccess; i++) {
+        int b = trace[i];
+        if (cached[b]) {
+            hits++;
+            list_remove(&l, b);
+        } else if (l.size == c) {
+            cached[l.tail] = 0;
+            list_remove(&l, l.tail);
+        }
+        cached[b] = 1;
+        list_push(&l, b);
+    }
+    free(cached);
+    return hits;
+}
+
+static unsigned sim_clock(unsigned c) {
+    int *slot = malloc(nblocks * sizeof(int));    // block -> slot or NIL
+    int *frame = malloc(c * sizeof(int));         // slot -> block or NIL
+    char *ref = calloc(c, 1);
+    unsigned hand = 0, hits = 0;
+
+    for (unsigned b = 0; b < nblocks; b++) slot[b] = NIL;
+    for (unsigned s = 0; s < c; s++) frame[s] = NIL;
+    for (unsigned i = 0; i < naccess; i++) {
+        int b = trace[i];
+        if (slot[b] != NIL) {
+            hits++;
+            ref[slot[b]] = 1;
+            continue;
+        }
+        while (frame[hand] != NIL && ref[hand]) {  // second chance
+            ref[hand] = 0;
+            hand = (hand + 1) % c;
+        }
+        if (frame[hand] != NIL) slot[frame[hand]] = NIL;
+        frame[hand] = b;
+        slot[b] = hand;
+        ref[hand] = 0;
+        hand = (hand + 1) % c;
+    }
+    free(slot);
+    free(frame);
+    free(ref);
+    return hits;
+}
+
+/** ARC (Megiddo and Modha, FAST'03): T1/T2 hold cached blocks seen once /
+ *  more than once, B1/B2 the ghosts evicted from them, p the T1 target size
+ */
+enum { NONE, T1, T2, B1, B2 };
+
+static struct list arc[5];
+static char *where;         // block -> NONE, T1, T2, B1 or B2
+static unsigned p;
+
+static void arc_move(int b, int to) {
+    if (where[b] != NONE) list_remove(&arc[(int)where[b]], b);
+    where[b] = to;
+    if (to != NONE) list_push(&arc[to], b);
+}
+
+static void arc_replace(int b, unsigned c) {
+    unsigned t1 = arc[T1].size;
+
+    if (t1 + arc[T2].size < c) return;  // still room in the cache
+    if (t1 > 0 && (t1 > p || (where[b] == B2 && t1 == p)))
+        arc_move(arc[T1].tail, B1);
+    else
+        arc_move(arc[T2].tail, B2);
+}
+
+static unsigned sim_arc(unsigned c) {
+    unsigned hits = 0;
+
+    where = calloc(nblocks, 1);
+    for (int i = T1; i <= B2; i++) list_init(&arc[i]);
+    p = 0;
+    for (unsigned i = 0; i < naccess; i++) {
+        int b = trace[i];
+        unsigned d;
+        switch (where[b]) {
+        case T1:
+        case T2:
+            hits++;
+            arc_move(b, T2);
+            break;
+        case B1:
+            d = arc[B2].size > arc[B1].size ? arc[B2].size / arc[B1].size : 1;
+            p = p + d < c ? p + d : c;
+            arc_replace(b, c);
+            arc_move(b, T2);
+            break;
+        case B2:
+            d = arc[B1].size > arc[B2].size ? arc[B1].size / arc[B2].size : 1;
+            p = p > d ? p - d : 0;
+            arc_replace(b, c);
+            arc_move(b, T2);
+            break;
+        default: {
+            unsigned l1 = arc[T1].size + arc[B1].size;
+            unsigned all = l1 + arc[T2].size + arc[B2].size;
+            if (l1 == c) {
+                if (arc[T1].size < c) {
+                    arc_move(arc[B1].tail, NONE);
+                    arc_replace(b, c);
+                } else
+                    arc_move(arc[T1].tail, NONE);
+            } else if (all >= c) {
+                if (all == 2 * c) arc_move(arc[B2].tail, NONE);
+                arc_replace(b, c);
+            }
+            arc_move(b, T1);
+        }
+        }
+    }
+    free(where);
+    return hits;
+}
+
+
+/** loads the trace ring in filename, oldest record first, into trace[];
+ *  prints per category counts; returns -1 if error
+ */
+static int load_trace(const char *filename) {
+    struct disk_trace_hdr hdr;
+    unsigned long ops[DISK_T_NCAT][2] = {{0}};
+
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        perror(filename);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != DISK_TRACE_MAGIC ||
+        hdr.nrecords == 0 || hdr.nblocks == 0) {
+        printf("%s: not a block I/O trace\n", filename);
+        fclose(f);
+        return -1;
+    }
+    unsigned nrec = hdr.total < hdr.nrecords ? hdr.total : hdr.nrecords;
+    struct disk_trace_rec *rec = malloc((nrec + 1) * sizeof(*rec));
+    if (rec == NULL) {
+        printf("%s: out of memory\n", filename);
+        fclose(f);
+        return -1;
+    }
+    if (fread(rec, sizeof(*rec), nrec, f) != nrec) {
+        printf("%s: truncated trace\n", filename);
+        free(rec);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    nblocks = hdr.nblocks;
+    naccess = 0;
+    for (unsigned i = 0; i < nrec; i++)
+        naccess += rec[i].count;
+    trace = malloc((naccess + 1) * sizeof(unsigned));
+    if (trace == NULL) {
+        printf("%s: out of memory\n", filename);
+        free(rec);
+        return -1;
+    }
+    naccess = 0;
+    unsigned first = hdr.total < hdr.nrecords ? 0 : hdr.total % hdr.nrecords;
+    for (unsigned i = 0; i < nrec; i++) {
+        struct disk_trace_rec *r = &rec[(first + i) % nrec];
+        if (r->cat < DISK_T_NCAT && r->op <= DISK_T_WRITE)
+            ops[r->cat][r->op] += r->count;
+        for (unsigned k = 0; k < r->count; k++)
+            if (r->block + k < nblocks)
+                trace[naccess++] = r->block + k;
+    }
+    free(rec);
+
+    printf("%s: %u records (%llu traced), %u block accesses, %u blocks in device\n",
+           filename, nrec, (unsigned long long)hdr.total, naccess, nblocks);
+    printf("category    reads   writes\n");
+    for (int c = 0; c < DISK_T_NCAT; c++)
+        printf("%-8s %8lu %8lu\n", catname[c], ops[c][0], ops[c][1]);
+    return 0;
+}
+
+/**
+ * MAIN
+ * trace-sim tracefile [cachesize ...]
+ * cache sizes in blocks; by default powers of two up to the device size
+ */
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("use: %s tracefile [cachesize ...]\n", argv[0]);
+        return 1;
+    }
+    if (load_trace(argv[1]) < 0) return 1;
+    if (naccess == 0) return 0;
+
+    prev = malloc(nblocks * sizeof(int));
+    next = malloc(nblocks * sizeof(int));
+
+    unsigned nsizes = argc - 2;
+    unsigned *sizes = malloc((nsizes + 32) * sizeof(unsigned));
+    if (prev == NULL || next == NULL || sizes == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < nsizes; i++)
+        sizes[i] = atoi(argv[i + 2]);
+    if (nsizes == 0)
+        for (unsigned c = 1; c < 2 * nblocks && nsizes < 32; c *= 2)
+            sizes[nsizes++] = c;
+
+    printf("\nhit ratio (%%)\n");
+    printf("   blocks      LRU    CLOCK      ARC\n");
+    for (unsigned i = 0; i < nsizes; i++) {
+        unsigned c = sizes[i];
+        if (c == 0) continue;
+        printf("%9u %8.2f %8.2f %8.2f\n", c,
+               100.0 * sim_lru(c) / naccess,
+               100.0 * sim_clock(c) / naccess,
+               100.0 * sim_arc(c) / naccess);
+    }
+    return 0;
+}